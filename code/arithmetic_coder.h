@@ -2,6 +2,9 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <xmmintrin.h>
 
 // for parallel encoder
 #include <thread>
@@ -31,13 +34,85 @@ Scale Bits <= CodeBits - 2
 #define ARITH_SCALE_BIT_COUNT 14
 #define ARITH_MODEL_ORDER 16
 
+// adaptive model candidates each block picks from, see ModelConfigs
+#define ARITH_MODEL_CONFIG_COUNT 4
+#define ARITH_DEFAULT_MODEL 0
+// selection samples at most an eighth of a block, but never less than the 
+// minimum so small blocks still get a meaningful comparison
+#define ARITH_MODEL_SELECT_SAMPLE_SIZE KB(128)
+#define ARITH_MODEL_SELECT_MIN_SAMPLE_SIZE KB(4)
+
+// sampled size estimates split their sample into this many windows spread over the block
+#define ARITH_ESTIMATE_WINDOW_COUNT 4
+
+// estimator looks up -log2(p) for every representable probability, 
+// in fixed point fine enough that p close to 1 doesn't round to free
+#define ARITH_COST_FRACTION_BIT_COUNT 16
+
 #define KB(Value) (1024ULL*(Value))
 #define MB(Value) (1024ULL*KB(Value))
 
+/*NOTE(chen):
+
+parallel stream layout, all fields little-endian:
+
+frame:
+    frame_header
+    BlockCount * frame_block_entry
+    BlockCount * encoded block (header + arithmetic coded bits)
+
+A stream is any number of frames back to back. Each frame carries its own
+block table so frames are self-delimiting, which means appending data is
+just writing another frame at the end of an existing stream.
+
+*/
+
+#define ARITH_FRAME_MAGIC 0x46435241 // "ARCF"
+#define ARITH_FRAME_VERSION 3
+#define ARITH_FRAME_MIN_VERSION 1 // oldest version still decoded
+
+// frame flags
+#define ARITH_FRAME_STATIC_MODEL (1 << 0)
+#define ARITH_FRAME_KNOWN_FLAGS (ARITH_FRAME_STATIC_MODEL)
+
+/*NOTE(chen):
+
+static model frames have the quantized model between the frame header and 
+the block table:
+
+    u32 ModelByteCount
+    u8 Present[ContextCount/8]    one bit per context seen by the first pass
+    Prob[popcount(Present)]       P(0) of each present context in 1/4096 steps,
+                                  12 bits each, packed lsb first
+
+Before version 3 Prob was a byte per context in 1/256 steps and every block 
+was coded with the model. Since then blocks the model fits badly are coded 
+adaptively, header::ModelId is ARITH_STATIC_MODEL_ID for the ones that aren't.
+
+*/
+
+#define ARITH_STATIC_PROB_BIT_COUNT 12
+#define ARITH_STATIC_MODEL_ID 0xFF
+
 #pragma pack(push, 1)
 struct header
 {
-    size_t EncodedByteCount;
+    u64 EncodedByteCount;
+    u8 ModelId;
+};
+
+struct frame_header
+{
+    u32 Magic;
+    u16 Version;
+    u16 Flags;
+    u32 BlockCount;
+};
+
+struct frame_block_entry
+{
+    u64 RawSize;
+    u64 EncodedSize;
 };
 #pragma pack(pop)
 
@@ -47,6 +122,20 @@ struct memory
     size_t Size;
 };
 
+//NOTE(chen): walks an array of memory segments as if it were one buffer,
+//            lets blocks straddle segment boundaries without copying
+struct segment_cursor
+{
+    memory *Segments;
+    size_t SegmentCount;
+    size_t SegmentI;
+    size_t Offset;
+    
+    __forceinline void Advance(size_t ByteCount);
+    __forceinline u8 ReadByte();
+    __forceinline void WriteByte(u8 Byte);
+};
+
 struct interval
 {
     u8 Symbol;
@@ -55,16 +144,80 @@ struct interval
     u32 Max;
 };
 
+struct model_config
+{
+    int Order; // bits of history used as context, at most ARITH_MODEL_ORDER
+    int Rate; // adaptation shift, lower adapts faster
+};
+
+//NOTE(chen): indexed by header::ModelId, only ever append to this
+static const model_config ModelConfigs[ARITH_MODEL_CONFIG_COUNT] = 
+{
+    {16, 6},
+    {16, 4},
+    {12, 5},
+    {8, 4},
+};
+
 struct model
 {
     u32 Prob[1<<(1*ARITH_MODEL_ORDER)];
     int Context;
+    int ContextMask;
+    int Rate;
+    
+    __forceinline void Init(model_config Config = ModelConfigs[ARITH_DEFAULT_MODEL]);
+    __forceinline u32 GetProb();
+    __forceinline void UpdateOne();
+    __forceinline void UpdateZero();
+    
+    __forceinline size_t GetContextSize();
+    __forceinline void Prefetch();
+};
+
+//NOTE(chen): adaptive model meant to be kept around between small messages.
+//            Every entry remembers the epoch it was last written in and entries 
+//            from older epochs read as Scale/2, so Init only bumps the epoch 
+//            instead of rewriting the whole table
+struct lazy_model
+{
+    u32 Entries[1<<(1*ARITH_MODEL_ORDER)]; // epoch in the high 16 bits, prob in the low 16
+    u32 Epoch;
+    int Context;
+    int ContextMask;
+    int Rate;
+    
+    __forceinline void Init(model_config Config = ModelConfigs[ARITH_DEFAULT_MODEL]);
+    __forceinline u32 GetProb();
+    __forceinline void UpdateOne();
+    __forceinline void UpdateZero();
+    
+    __forceinline size_t GetContextSize();
+    __forceinline void Prefetch();
+};
+
+//NOTE(chen): frozen model from a semi-static first pass, coding only advances
+//            the context so the table is read-only and shared between blocks
+struct static_model
+{
+    u16 *Prob;
+    int Context;
     
-    __forceinline void Init();
+    __forceinline u32 GetProb();
     __forceinline void UpdateOne();
     __forceinline void UpdateZero();
     
     __forceinline size_t GetContextSize();
+    __forceinline void Prefetch();
+};
+
+//NOTE(chen): -log2(p) in 1/65536ths of a bit, indexed by the scaled probability
+struct cost_table
+{
+    u32 Cost[1<<ARITH_SCALE_BIT_COUNT];
+    
+    void Init();
+    __forceinline u32 GetCost(u32 Prob);
 };
 
 struct encoder_state
@@ -82,18 +235,157 @@ struct encoder_state
 struct decoder_state
 {
     u8 *InputStream;
+    size_t InputSize;
     size_t OutputSize;
-    u8 *Output;
     u8 StagingByte;
     size_t BytesRead;
     int BitsLeft;
     u8 BitMask;
-    header *Header;
+    header Header;
     
     __forceinline u8 InputBit();
-    __forceinline void Init(u8 *Bits);
+    __forceinline void Init(u8 *Bits, size_t EncodedSize, u16 Version);
 };
 
+__forceinline void
+WriteU16LE(u8 *Dest, u16 Value)
+{
+    Dest[0] = (u8)(Value);
+    Dest[1] = (u8)(Value >> 8);
+}
+
+__forceinline void
+WriteU32LE(u8 *Dest, u32 Value)
+{
+    for (int ByteI = 0; ByteI < 4; ++ByteI)
+    {
+        Dest[ByteI] = (u8)(Value >> (8*ByteI));
+    }
+}
+
+__forceinline void
+WriteU64LE(u8 *Dest, u64 Value)
+{
+    for (int ByteI = 0; ByteI < 8; ++ByteI)
+    {
+        Dest[ByteI] = (u8)(Value >> (8*ByteI));
+    }
+}
+
+__forceinline u16
+ReadU16LE(u8 *Src)
+{
+    return (u16)(Src[0] | (Src[1] << 8));
+}
+
+__forceinline u32
+ReadU32LE(u8 *Src)
+{
+    u32 Value = 0;
+    for (int ByteI = 3; ByteI >= 0; --ByteI)
+    {
+        Value = (Value << 8) | Src[ByteI];
+    }
+    return Value;
+}
+
+__forceinline u64
+ReadU64LE(u8 *Src)
+{
+    u64 Value = 0;
+    for (int ByteI = 7; ByteI >= 0; --ByteI)
+    {
+        Value = (Value << 8) | Src[ByteI];
+    }
+    return Value;
+}
+
+//NOTE(chen): version 1 frames predate header::ModelId, their blocks 
+//            have an 8 byte header and use the default model
+__forceinline size_t
+GetBlockHeaderSize(u16 Version)
+{
+    return Version < 2? sizeof(u64): sizeof(header);
+}
+
+__forceinline header
+ReadBlockHeader(u8 *Bits, u16 Version)
+{
+    header Header = {};
+    Header.EncodedByteCount = ReadU64LE(Bits);
+    Header.ModelId = Version < 2? ARITH_DEFAULT_MODEL: Bits[8];
+    return Header;
+}
+
+__forceinline bool
+IsStaticBlock(u16 Flags, u16 Version, header Header)
+{
+    if (!(Flags & ARITH_FRAME_STATIC_MODEL)) return false;
+    return Version < 3 || Header.ModelId == ARITH_STATIC_MODEL_ID;
+}
+
+__forceinline void
+segment_cursor::Advance(size_t ByteCount)
+{
+    while (ByteCount > 0 && SegmentI < SegmentCount)
+    {
+        size_t BytesLeft = Segments[SegmentI].Size - Offset;
+        if (ByteCount < BytesLeft)
+        {
+            Offset += ByteCount;
+            break;
+        }
+        
+        ByteCount -= BytesLeft;
+        SegmentI += 1;
+        Offset = 0;
+    }
+}
+
+__forceinline u8
+segment_cursor::ReadByte()
+{
+    while (Offset == Segments[SegmentI].Size)
+    {
+        SegmentI += 1;
+        Offset = 0;
+    }
+    
+    return Segments[SegmentI].Data[Offset++];
+}
+
+__forceinline void
+segment_cursor::WriteByte(u8 Byte)
+{
+    while (Offset == Segments[SegmentI].Size)
+    {
+        SegmentI += 1;
+        Offset = 0;
+    }
+    
+    Segments[SegmentI].Data[Offset++] = Byte;
+}
+
+size_t Min(size_t A, size_t B)
+{
+    return A < B? A: B;
+}
+
+size_t Max(size_t A, size_t B)
+{
+    return A > B? A: B;
+}
+
+size_t GetSegmentsSize(memory *Segments, size_t SegmentCount)
+{
+    size_t Size = 0;
+    for (size_t SegmentI = 0; SegmentI < SegmentCount; ++SegmentI)
+    {
+        Size += Segments[SegmentI].Size;
+    }
+    return Size;
+}
+
 __forceinline void 
 encoder_state::OutputBit(u8 Bit)
 {
@@ -114,8 +406,11 @@ encoder_state::OutputBit(u8 Bit)
 }
 
 __forceinline void
-model::Init()
+model::Init(model_config Config)
 {
+    ContextMask = (1 << Config.Order) - 1;
+    Rate = Config.Rate;
+    
     u32 Scale = 1 << ARITH_SCALE_BIT_COUNT;
     for (int ContextI = 0; ContextI < GetContextSize(); ++ContextI)
     {
@@ -129,42 +424,147 @@ __forceinline
 void model::UpdateOne()
 {
     u32 Scale = 1 << ARITH_SCALE_BIT_COUNT;
-    Prob[Context] -= Prob[Context] >> 6;
-    Context = ((Context << 1) + 1) % GetContextSize();
+    Prob[Context] -= Prob[Context] >> Rate;
+    Context = ((Context << 1) + 1) & ContextMask;
 }
 
 __forceinline 
 void model::UpdateZero()
 {
     u32 Scale = 1 << ARITH_SCALE_BIT_COUNT;
-    Prob[Context] += (Scale - Prob[Context]) >> 6;
-    Context = (Context << 1) % GetContextSize();
+    Prob[Context] += (Scale - Prob[Context]) >> Rate;
+    Context = (Context << 1) & ContextMask;
 }
 
 __forceinline size_t
 model::GetContextSize()
+{
+    return (size_t)ContextMask + 1;
+}
+
+__forceinline u32
+model::GetProb()
+{
+    return Prob[Context];
+}
+
+__forceinline void
+model::Prefetch()
+{
+    //NOTE(chen): whatever the next 3 bits turn out to be, their 8 contexts 
+    //            are adjacent u32s sitting in one cache line
+    size_t Ahead = (Context << 3) & ContextMask;
+    _mm_prefetch((char *)(Prob + Ahead), _MM_HINT_T0);
+}
+
+__forceinline void
+lazy_model::Init(model_config Config)
+{
+    ContextMask = (1 << Config.Order) - 1;
+    Rate = Config.Rate;
+    
+    // epoch 0 is what a zeroed table holds, so wrapping around needs a real clear
+    Epoch += 1;
+    if (Epoch > 0xFFFF)
+    {
+        memset(Entries, 0, sizeof(Entries));
+        Epoch = 1;
+    }
+    
+    Context = 0;
+}
+
+__forceinline u32
+lazy_model::GetProb()
+{
+    u32 Scale = 1 << ARITH_SCALE_BIT_COUNT;
+    u32 Entry = Entries[Context];
+    return (Entry >> 16) == Epoch? (Entry & 0xFFFF): (Scale >> 1);
+}
+
+__forceinline 
+void lazy_model::UpdateOne()
+{
+    u32 Prob = GetProb();
+    Prob -= Prob >> Rate;
+    Entries[Context] = (Epoch << 16) | Prob;
+    Context = ((Context << 1) + 1) & ContextMask;
+}
+
+__forceinline 
+void lazy_model::UpdateZero()
+{
+    u32 Scale = 1 << ARITH_SCALE_BIT_COUNT;
+    u32 Prob = GetProb();
+    Prob += (Scale - Prob) >> Rate;
+    Entries[Context] = (Epoch << 16) | Prob;
+    Context = (Context << 1) & ContextMask;
+}
+
+__forceinline size_t
+lazy_model::GetContextSize()
+{
+    return (size_t)ContextMask + 1;
+}
+
+__forceinline void
+lazy_model::Prefetch()
+{
+    size_t Ahead = (Context << 3) & ContextMask;
+    _mm_prefetch((char *)(Entries + Ahead), _MM_HINT_T0);
+}
+
+__forceinline u32
+static_model::GetProb()
+{
+    return Prob[Context];
+}
+
+__forceinline 
+void static_model::UpdateOne()
+{
+    Context = ((Context << 1) + 1) % GetContextSize();
+}
+
+__forceinline 
+void static_model::UpdateZero()
+{
+    Context = (Context << 1) % GetContextSize();
+}
+
+__forceinline size_t
+static_model::GetContextSize()
 {
     return 1<<(1*ARITH_MODEL_ORDER);
 }
 
+__forceinline void
+static_model::Prefetch()
+{
+    //NOTE(chen): whatever the next 4 bits turn out to be, their 16 contexts 
+    //            are adjacent u16s sitting in one cache line
+    size_t Ahead = (Context << 4) % GetContextSize();
+    _mm_prefetch((char *)(Prob + Ahead), _MM_HINT_T0);
+}
+
 __forceinline void 
 encoder_state::Init(header Header)
 {
     OutputCap = sizeof(Header);
     OutputStream = (u8 *)calloc(OutputCap, 1);
-    *((header *)OutputStream) = Header;
+    WriteU64LE(OutputStream, Header.EncodedByteCount);
+    OutputStream[8] = Header.ModelId;
     OutputSize = OutputCap;
 }
 
-memory Encode(u8 *Data, size_t DataSize)
+template <typename model_type>
+memory EncodeWithModel(segment_cursor Input, size_t DataSize, model_type *Model, u8 ModelId)
 {
-    model *Model = (model *)calloc(1, sizeof(model));
-    Model->Init();
-    
     encoder_state State = {};
     
     header Header = {};
     Header.EncodedByteCount = DataSize;
+    Header.ModelId = ModelId;
     
     State.Init(Header);
     
@@ -181,7 +581,7 @@ memory Encode(u8 *Data, size_t DataSize)
     size_t BitsPending = 0;
     for (size_t ByteI = 0; ByteI < DataSize; ++ByteI)
     {
-        u8 Byte = Data[ByteI];
+        u8 Byte = Input.ReadByte();
         u8 BitMask = 1 << 7;
         for (int BitI = 0; BitI < 8; ++BitI)
         {
@@ -191,14 +591,14 @@ memory Encode(u8 *Data, size_t DataSize)
             u32 IntervalMin, IntervalMax;
             if (Symbol)
             {
-                IntervalMin = Model->Prob[Model->Context];
+                IntervalMin = Model->GetProb();
                 IntervalMax = Scale;
                 Model->UpdateOne();
             }
             else
             {
                 IntervalMin = 0;
-                IntervalMax = Model->Prob[Model->Context];
+                IntervalMax = Model->GetProb();
                 Model->UpdateZero();
             }
             
@@ -270,9 +670,26 @@ memory Encode(u8 *Data, size_t DataSize)
         ASSERT(State.BitsFilled == 0);
     }
     
+    return {State.OutputStream, State.OutputSize};
+}
+
+memory EncodeSegments(segment_cursor Input, size_t DataSize, u8 ModelId = ARITH_DEFAULT_MODEL)
+{
+    model *Model = (model *)calloc(1, sizeof(model));
+    Model->Init(ModelConfigs[ModelId]);
+    
+    memory Result = EncodeWithModel(Input, DataSize, Model, ModelId);
+    
     free(Model);
     
-    return {State.OutputStream, State.OutputSize};
+    return Result;
+}
+
+memory Encode(u8 *Data, size_t DataSize)
+{
+    memory Segment = {Data, DataSize};
+    segment_cursor Input = {&Segment, 1};
+    return EncodeSegments(Input, DataSize);
 }
 
 __forceinline u8
@@ -280,7 +697,10 @@ decoder_state::InputBit()
 {
     if (BitsLeft == 0)
     {
-        StagingByte = InputStream[BytesRead++];
+        // the decoder looks up to ARITH_CODE_BIT_COUNT bits ahead of what the 
+        // encoder flushed, those read as zeros instead of whatever follows the block
+        StagingByte = BytesRead < InputSize? InputStream[BytesRead]: 0;
+        BytesRead += 1;
         BitsLeft = 8;
         BitMask = 1 << 7;
     }
@@ -293,23 +713,24 @@ decoder_state::InputBit()
 }
 
 __forceinline void
-decoder_state::Init(u8 *Bits)
+decoder_state::Init(u8 *Bits, size_t EncodedSize, u16 Version)
 {
-    Header = (header *)Bits;
-    Bits += sizeof(header);
-    InputStream = Bits;
+    size_t HeaderSize = GetBlockHeaderSize(Version);
+    Header = ReadBlockHeader(Bits, Version);
+    InputStream = Bits + HeaderSize;
+    InputSize = EncodedSize > HeaderSize? EncodedSize - HeaderSize: 0;
     
-    OutputSize = Header->EncodedByteCount;
-    Output = (u8 *)calloc(Header->EncodedByteCount, 1);
+    OutputSize = Header.EncodedByteCount;
 }
 
-memory Decode(u8 *Bits, size_t EncodedSize)
+//NOTE(chen): Output must have room for the block's EncodedByteCount bytes,
+//            returns the number of bytes written
+template <typename model_type>
+size_t DecodeWithModel(u8 *Bits, size_t EncodedSize, segment_cursor Output, model_type *Model, 
+                       u16 Version = ARITH_FRAME_VERSION)
 {
-    model *Model = (model *)calloc(1, sizeof(model));
-    Model->Init();
-    
     decoder_state State = {};
-    State.Init(Bits);
+    State.Init(Bits, EncodedSize, Version);
     
     u32 Scale = 1 << ARITH_SCALE_BIT_COUNT;
     u32 CodeBitMask = (1 << ARITH_CODE_BIT_COUNT) - 1;
@@ -328,14 +749,17 @@ memory Decode(u8 *Bits, size_t EncodedSize)
         EncodedValue = (EncodedValue << 1) | State.InputBit();
     }
     
-    for (size_t ByteI = 0; ByteI < State.Header->EncodedByteCount; ++ByteI)
+    for (size_t ByteI = 0; ByteI < State.OutputSize; ++ByteI)
     {
         u8 OutputByte = 0;
         
         for (int BitI = 0; BitI < 8; ++BitI)
         {
+            Model->Prefetch();
+            
+            u32 Prob = Model->GetProb();
             u32 Range = High - Low + 1;
-            u32 ArithMid = Low + ((Range * Model->Prob[Model->Context]) >> ARITH_SCALE_BIT_COUNT) - 1;
+            u32 ArithMid = Low + ((Range * Prob) >> ARITH_SCALE_BIT_COUNT) - 1;
             
             ASSERT(Low < High);
             u8 DecodedSymbol;
@@ -347,7 +771,7 @@ memory Decode(u8 *Bits, size_t EncodedSize)
             }
             else
             {
-                Low = Low + ((Range * Model->Prob[Model->Context]) >> ARITH_SCALE_BIT_COUNT);
+                Low = Low + ((Range * Prob) >> ARITH_SCALE_BIT_COUNT);
                 DecodedSymbol = 1;
                 Model->UpdateOne();
             }
@@ -385,180 +809,1275 @@ memory Decode(u8 *Bits, size_t EncodedSize)
             OutputByte |= DecodedSymbol << (7-BitI);
         }
         
-        State.Output[ByteI] = OutputByte;
+        Output.WriteByte(OutputByte);
+    }
+    
+    return State.OutputSize;
+}
+
+size_t DecodeSegments(u8 *Bits, size_t EncodedSize, segment_cursor Output, 
+                      u16 Version = ARITH_FRAME_VERSION)
+{
+    u8 ModelId = ReadBlockHeader(Bits, Version).ModelId;
+    if (ModelId >= ARITH_MODEL_CONFIG_COUNT)
+    {
+        return 0;
     }
     
+    model *Model = (model *)calloc(1, sizeof(model));
+    Model->Init(ModelConfigs[ModelId]);
+    
+    size_t Result = DecodeWithModel(Bits, EncodedSize, Output, Model, Version);
+    
     free(Model);
     
-    return {State.Output, State.OutputSize};
+    return Result;
 }
 
-struct job
+memory Decode(u8 *Bits, size_t EncodedSize)
 {
-    volatile memory Input;
-    volatile memory Output;
-};
+    memory Segment = {};
+    Segment.Size = ReadU64LE(Bits);
+    Segment.Data = (u8 *)calloc(Segment.Size, 1);
+    
+    segment_cursor Output = {&Segment, 1};
+    DecodeSegments(Bits, EncodedSize, Output);
+    
+    return Segment;
+}
 
-size_t Min(size_t A, size_t B)
+void
+cost_table::Init()
 {
-    return A < B? A: B;
+    int EntryCount = 1<<ARITH_SCALE_BIT_COUNT;
+    for (int EntryI = 0; EntryI < EntryCount; ++EntryI)
+    {
+        // models never hand out a probability of 0, keep that entry finite anyway
+        f64 Prob = f64(EntryI? EntryI: 1) / f64(EntryCount);
+        Cost[EntryI] = (u32)(-log2(Prob) * f64(1<<ARITH_COST_FRACTION_BIT_COUNT) + 0.5);
+    }
 }
 
-memory EncodeParallel(u8 *Data, size_t DataSize, size_t BlockSize = MB(1))
+__forceinline u32
+cost_table::GetCost(u32 Prob)
 {
-    size_t JobCount = (DataSize - 1) / BlockSize + 1;
-    job *Jobs = (job *)calloc(JobCount, sizeof(job));
-    std::atomic<size_t> NextJobIndex = 0;
-    
-    // build jobs
-    for (size_t JobI = 0; JobI < JobCount; ++JobI)
+    return Cost[Prob];
+}
+
+//NOTE(chen): runs the model exactly like EncodeWithModel but only sums up 
+//            the ideal code length, returns it in 1/65536ths of a bit
+template <typename model_type>
+u64 EstimateWithModel(segment_cursor Input, size_t DataSize, model_type *Model, cost_table *CostTable)
+{
+    u32 Scale = 1 << ARITH_SCALE_BIT_COUNT;
+    u64 TotalCost = 0;
+    for (size_t ByteI = 0; ByteI < DataSize; ++ByteI)
     {
-        job *Job = Jobs + JobI;
-        Job->Input.Data = Data + Min(JobI*BlockSize, DataSize);
-        Job->Input.Size = Min(BlockSize, DataSize-JobI*BlockSize);
+        u8 Byte = Input.ReadByte();
+        for (int BitI = 7; BitI >= 0; --BitI)
+        {
+            u32 Prob = Model->GetProb();
+            if ((Byte >> BitI) & 1)
+            {
+                TotalCost += CostTable->GetCost(Scale - Prob);
+                Model->UpdateOne();
+            }
+            else
+            {
+                TotalCost += CostTable->GetCost(Prob);
+                Model->UpdateZero();
+            }
+        }
     }
     
-    auto WorkerFunc = [&]() {
-        size_t JobIndex = NextJobIndex.fetch_add(1);
-        while (JobIndex < JobCount)
-        {
-            job *Job = Jobs + JobIndex;
-            
-            memory Encoded = Encode(Job->Input.Data, Job->Input.Size);
-            Job->Output.Data = Encoded.Data;
-            Job->Output.Size = Encoded.Size;
+    return TotalCost;
+}
+
+size_t GetSelectSampleSize(size_t DataSize)
+{
+    size_t SampleSize = Min(DataSize / 8, ARITH_MODEL_SELECT_SAMPLE_SIZE);
+    return Max(SampleSize, Min(DataSize, ARITH_MODEL_SELECT_MIN_SAMPLE_SIZE));
+}
+
+//NOTE(chen): estimates the first SampleSize bytes of a block with every model 
+//            config in a single pass and returns the one with the smallest cost.
+//            Only the second half of the sample is scored, otherwise fast adapting
+//            configs win on warm-up alone and lose over the rest of the block.
+//            Models holds ARITH_MODEL_CONFIG_COUNT lazy models that callers keep 
+//            around between blocks, so small blocks don't pay for clearing tables.
+//            They are left at the end of the sample and SampleCosts gets each one's 
+//            cost over the whole sample, the caller can keep going with the winner
+u8 SelectModel(segment_cursor Input, size_t SampleSize, cost_table *CostTable,
+               lazy_model *Models, u64 *SampleCosts)
+{
+    for (int ModelId = 0; ModelId < ARITH_MODEL_CONFIG_COUNT; ++ModelId)
+    {
+        Models[ModelId].Init(ModelConfigs[ModelId]);
+        SampleCosts[ModelId] = 0;
+    }
+    
+    u32 Scale = 1 << ARITH_SCALE_BIT_COUNT;
+    size_t WarmupSize = SampleSize / 2;
+    u64 WarmupCosts[ARITH_MODEL_CONFIG_COUNT] = {};
+    for (size_t ByteI = 0; ByteI < SampleSize; ++ByteI)
+    {
+        if (ByteI == WarmupSize)
+        {
+            memcpy(WarmupCosts, SampleCosts, sizeof(WarmupCosts));
+        }
+        
+        u8 Byte = Input.ReadByte();
+        for (int BitI = 7; BitI >= 0; --BitI)
+        {
+            u32 Bit = (Byte >> BitI) & 1;
+            for (int ModelId = 0; ModelId < ARITH_MODEL_CONFIG_COUNT; ++ModelId)
+            {
+                lazy_model *Model = Models + ModelId;
+                u32 Prob = Model->GetProb();
+                if (Bit)
+                {
+                    SampleCosts[ModelId] += CostTable->GetCost(Scale - Prob);
+                    Model->UpdateOne();
+                }
+                else
+                {
+                    SampleCosts[ModelId] += CostTable->GetCost(Prob);
+                    Model->UpdateZero();
+                }
+            }
+        }
+    }
+    
+    u8 BestModelId = ARITH_DEFAULT_MODEL;
+    u64 BestCost = (u64)-1;
+    for (int ModelId = 0; ModelId < ARITH_MODEL_CONFIG_COUNT; ++ModelId)
+    {
+        u64 Cost = SampleCosts[ModelId] - WarmupCosts[ModelId];
+        if (Cost < BestCost)
+        {
+            BestCost = Cost;
+            BestModelId = (u8)ModelId;
+        }
+    }
+    
+    return BestModelId;
+}
+
+//NOTE(chen): predicted size of what EncodeSegments would output with the model 
+//            config the encoder would select, header included.
+//            A non-zero SampleSize only models that many bytes, split into 
+//            ARITH_ESTIMATE_WINDOW_COUNT windows: the first at the start of the block 
+//            where the config gets selected, the rest spread evenly over the block.
+//            The model carries on from window to window, the first half of each later 
+//            window only gets it used to the new spot and the rest of the block is 
+//            extrapolated from the cost of the second halves.
+//            Sampled estimates still run high since a model that has seen SampleSize
+//            bytes predicts worse than one that has seen the whole block, on text, 
+//            executables and meshes: +5..60% with 16KB samples, -2..+20% with 64KB, 
+//            within 10% with 128KB. Samples that don't reach past the selection pass
+//            (under 8KB) can only be scaled linearly and are off by up to 2x
+size_t EstimateSegments(segment_cursor Input, size_t DataSize, cost_table *CostTable, 
+                        lazy_model *Models, size_t SampleSize = 0)
+{
+    size_t ModeledSize = DataSize;
+    if (SampleSize && SampleSize < DataSize)
+    {
+        ModeledSize = SampleSize;
+    }
+    
+    // the selection pass already modeled the start of the block, carry on with the winner
+    u64 SampleCosts[ARITH_MODEL_CONFIG_COUNT];
+    size_t SelectSampleSize = GetSelectSampleSize(ModeledSize);
+    u8 ModelId = SelectModel(Input, SelectSampleSize, CostTable, Models, SampleCosts);
+    lazy_model *Model = Models + ModelId;
+    
+    segment_cursor Rest = Input;
+    Rest.Advance(SelectSampleSize);
+    u64 Cost = SampleCosts[ModelId];
+    if (ModeledSize == DataSize)
+    {
+        Cost += EstimateWithModel(Rest, DataSize - SelectSampleSize, Model, CostTable);
+    }
+    else
+    {
+        size_t WindowSize = ModeledSize / ARITH_ESTIMATE_WINDOW_COUNT;
+        size_t FirstWindowSize = Max(WindowSize, SelectSampleSize);
+        Cost += EstimateWithModel(Rest, FirstWindowSize - SelectSampleSize, Model, CostTable);
+        
+        size_t WindowCount = WindowSize? (ModeledSize - FirstWindowSize) / WindowSize: 0;
+        if (WindowCount)
+        {
+            // the last window ends with the block
+            size_t WarmupSize = WindowSize / 2;
+            u64 WindowCost = 0;
+            for (size_t WindowI = 1; WindowI <= WindowCount; ++WindowI)
+            {
+                segment_cursor Window = Input;
+                Window.Advance(FirstWindowSize + 
+                               (DataSize - FirstWindowSize - WindowSize) * WindowI / WindowCount);
+                EstimateWithModel(Window, WarmupSize, Model, CostTable);
+                Window.Advance(WarmupSize);
+                WindowCost += EstimateWithModel(Window, WindowSize - WarmupSize, Model, CostTable);
+            }
             
+            size_t ScoredSize = WindowCount * (WindowSize - WarmupSize);
+            Cost += u64(f64(WindowCost) * f64(DataSize - FirstWindowSize) / f64(ScoredSize));
+        }
+        else
+        {
+            // sample is no bigger than the selection pass, nothing to go on but that
+            Cost = u64(f64(Cost) * f64(DataSize) / f64(FirstWindowSize));
+        }
+    }
+    
+    // whole bytes of ideal code length, plus the byte the final flush spills into
+    size_t CodedSize = (size_t)(Cost >> (ARITH_COST_FRACTION_BIT_COUNT + 3)) + 1;
+    return sizeof(header) + CodedSize;
+}
+
+struct job
+{
+    segment_cursor Raw;
+    size_t RawSize;
+    volatile memory Encoded;
+    u16 *StaticProb;
+    u16 Version; // of the frame being decoded
+    u8 ModelId; // what the block gets encoded with
+    size_t StaticSaving; // bytes, see SelectJobModel
+};
+
+size_t GetWorkerCount(size_t JobCount)
+{
+    // no more workers than there are jobs for, calling thread included
+    size_t WorkerCount = Max(std::thread::hardware_concurrency(), 1);
+    return Min(WorkerCount, Max(JobCount, 1));
+}
+
+//NOTE(chen): runs JobFunc(JobIndex, WorkerIndex) for every job, calling thread included.
+//            WorkerIndex is below GetWorkerCount(JobCount) and no two jobs run on the 
+//            same worker at once, so it can pick per worker scratch memory
+template <typename job_func>
+void RunWorkerJobs(size_t JobCount, job_func JobFunc)
+{
+    std::atomic<size_t> NextJobIndex = 0;
+    
+    auto WorkerFunc = [&](size_t WorkerIndex) {
+        size_t JobIndex = NextJobIndex.fetch_add(1);
+        while (JobIndex < JobCount)
+        {
+            JobFunc(JobIndex, WorkerIndex);
             JobIndex = NextJobIndex.fetch_add(1);
         }
     };
     
-    // spin up workers
-    int WorkerCount = std::thread::hardware_concurrency() - 1;
+    // spin up workers, the calling thread is worker 0
+    size_t WorkerCount = (JobCount? GetWorkerCount(JobCount): 1) - 1;
     std::thread *Workers = (std::thread *)calloc(WorkerCount, sizeof(std::thread));
-    for (int WorkerI = 0; WorkerI < WorkerCount; ++WorkerI)
+    for (size_t WorkerI = 0; WorkerI < WorkerCount; ++WorkerI)
     {
-        Workers[WorkerI] = std::thread(WorkerFunc);
+        Workers[WorkerI] = std::thread(WorkerFunc, WorkerI + 1);
     }
-    WorkerFunc();
+    WorkerFunc(0);
     
     // block until jobs are done
-    for (int WorkerI = 0; WorkerI < WorkerCount; ++WorkerI)
+    for (size_t WorkerI = 0; WorkerI < WorkerCount; ++WorkerI)
     {
         Workers[WorkerI].join();
     }
+    free(Workers);
+}
+
+//NOTE(chen): runs JobFunc(JobIndex) for every job, calling thread included
+template <typename job_func>
+void RunJobs(size_t JobCount, job_func JobFunc)
+{
+    RunWorkerJobs(JobCount, [&](size_t JobIndex, size_t) {
+        JobFunc(JobIndex);
+    });
+}
+
+//NOTE(chen): first pass of semi-static coding, Counts holds a zero and a one 
+//            count per context. Context starts at 0 for every block, same as coding
+void CountContexts(segment_cursor Input, size_t DataSize, u64 *Counts)
+{
+    size_t ContextMask = (1<<(1*ARITH_MODEL_ORDER)) - 1;
+    size_t Context = 0;
+    for (size_t ByteI = 0; ByteI < DataSize; ++ByteI)
+    {
+        u8 Byte = Input.ReadByte();
+        for (int BitI = 7; BitI >= 0; --BitI)
+        {
+            size_t Bit = (Byte >> BitI) & 1;
+            Counts[2*Context + Bit] += 1;
+            Context = ((Context << 1) + Bit) & ContextMask;
+        }
+    }
+}
+
+//NOTE(chen): quantizes counts into the serialized static model, see layout above
+memory BuildStaticModel(u64 *Counts)
+{
+    size_t ContextCount = 1<<(1*ARITH_MODEL_ORDER);
+    size_t PresentSize = ContextCount / 8;
     
-    // composite compressed data
-    size_t OutputSize = 0;
-    u8 *Output = 0;
+    memory Result = {};
+    Result.Data = (u8 *)calloc(PresentSize + (ContextCount * ARITH_STATIC_PROB_BIT_COUNT + 7) / 8, 1);
+    Result.Size = PresentSize;
+    
+    u32 MaxQuantized = (1 << ARITH_STATIC_PROB_BIT_COUNT) - 1;
+    u32 PackedBits = 0;
+    int PackedBitCount = 0;
+    for (size_t ContextI = 0; ContextI < ContextCount; ++ContextI)
+    {
+        u64 ZeroCount = Counts[2*ContextI];
+        u64 TotalCount = ZeroCount + Counts[2*ContextI + 1];
+        if (TotalCount == 0) continue;
+        
+        f64 ZeroProb = (f64(ZeroCount) + 0.5) / (f64(TotalCount) + 1.0);
+        u32 Quantized = (u32)(ZeroProb * f64(1 << ARITH_STATIC_PROB_BIT_COUNT) + 0.5);
+        if (Quantized < 1) Quantized = 1;
+        if (Quantized > MaxQuantized) Quantized = MaxQuantized;
+        
+        // absent contexts code at 1/2, only store the ones that save more than they take up
+        f64 StoredZeroProb = f64(Quantized) / f64(1 << ARITH_STATIC_PROB_BIT_COUNT);
+        f64 SavedBits = f64(TotalCount) + f64(ZeroCount) * log2(StoredZeroProb) + 
+            f64(TotalCount - ZeroCount) * log2(1.0 - StoredZeroProb);
+        if (SavedBits <= f64(ARITH_STATIC_PROB_BIT_COUNT + 1)) continue;
+        
+        Result.Data[ContextI / 8] |= 1 << (ContextI % 8);
+        PackedBits |= Quantized << PackedBitCount;
+        PackedBitCount += ARITH_STATIC_PROB_BIT_COUNT;
+        while (PackedBitCount >= 8)
+        {
+            Result.Data[Result.Size++] = (u8)PackedBits;
+            PackedBits >>= 8;
+            PackedBitCount -= 8;
+        }
+    }
+    
+    if (PackedBitCount > 0)
+    {
+        Result.Data[Result.Size++] = (u8)PackedBits;
+    }
+    
+    return Result;
+}
+
+//NOTE(chen): expands a serialized static model into a full probability table, 
+//            returns 0 if the model is malformed. Version is the frame's, 
+//            older frames quantized to 8 bits
+u16 *LoadStaticModel(u8 *ModelData, size_t ModelSize, u16 Version = ARITH_FRAME_VERSION)
+{
+    size_t ContextCount = 1<<(1*ARITH_MODEL_ORDER);
+    size_t PresentSize = ContextCount / 8;
+    if (ModelSize < PresentSize) return 0;
+    
+    int ProbBitCount = Version < 3? 8: ARITH_STATIC_PROB_BIT_COUNT;
+    u32 QuantizedMask = (1 << ProbBitCount) - 1;
+    u32 Scale = 1 << ARITH_SCALE_BIT_COUNT;
+    u16 *Prob = (u16 *)calloc(ContextCount, sizeof(u16));
+    size_t Cursor = PresentSize;
+    u32 PackedBits = 0;
+    int PackedBitCount = 0;
+    for (size_t ContextI = 0; ContextI < ContextCount; ++ContextI)
     {
-        OutputSize = 0;
-        OutputSize += sizeof(size_t) * (1 + JobCount); // header
-        for (int JobI = 0; JobI < JobCount; ++JobI)
+        if (ModelData[ContextI / 8] & (1 << (ContextI % 8)))
         {
-            OutputSize += Jobs[JobI].Output.Size;
+            while (PackedBitCount < ProbBitCount && Cursor < ModelSize)
+            {
+                PackedBits |= (u32)ModelData[Cursor++] << PackedBitCount;
+                PackedBitCount += 8;
+            }
+            
+            u32 Quantized = PackedBits & QuantizedMask;
+            if (PackedBitCount < ProbBitCount || Quantized == 0)
+            {
+                free(Prob);
+                return 0;
+            }
+            PackedBits >>= ProbBitCount;
+            PackedBitCount -= ProbBitCount;
+            
+            Prob[ContextI] = (u16)(Quantized << (ARITH_SCALE_BIT_COUNT - ProbBitCount));
         }
+        else
+        {
+            Prob[ContextI] = (u16)(Scale >> 1);
+        }
+    }
+    
+    if (Cursor != ModelSize)
+    {
+        free(Prob);
+        return 0;
+    }
+    
+    return Prob;
+}
+
+size_t GetBlockCount(size_t DataSize, size_t BlockSize)
+{
+    return DataSize? (DataSize - 1) / BlockSize + 1: 0;
+}
+
+//NOTE(chen): one job per BlockSize bytes of the segments, Jobs needs room for GetBlockCount
+void BuildEncodeJobs(job *Jobs, memory *Segments, size_t SegmentCount, size_t BlockSize)
+{
+    size_t DataSize = GetSegmentsSize(Segments, SegmentCount);
+    size_t JobCount = GetBlockCount(DataSize, BlockSize);
+    
+    segment_cursor RawCursor = {Segments, SegmentCount};
+    for (size_t JobI = 0; JobI < JobCount; ++JobI)
+    {
+        job *Job = Jobs + JobI;
+        Job->Raw = RawCursor;
+        Job->RawSize = Min(BlockSize, DataSize-JobI*BlockSize);
+        RawCursor.Advance(Job->RawSize);
+    }
+}
+
+//NOTE(chen): per worker models, reused from block to block so small blocks don't 
+//            pay for allocating them. Selection runs on lazy models, which never 
+//            need clearing, but coding a whole block is faster with a plain one
+struct encode_scratch
+{
+    lazy_model Candidates[ARITH_MODEL_CONFIG_COUNT];
+    model BlockModel;
+};
+
+//NOTE(chen): picks the block's adaptive config. In static frames it also 
+//            estimates the whole block with both that config and the frame's model,
+//            StaticSaving is how many bytes the static model would save, 0 if none.
+//            Whether the model gets used at all is up to the frame, it has to pay 
+//            for itself
+void SelectJobModel(job *Job, cost_table *CostTable, encode_scratch *Scratch)
+{
+    u64 SampleCosts[ARITH_MODEL_CONFIG_COUNT];
+    size_t SampleSize = GetSelectSampleSize(Job->RawSize);
+    u8 ModelId = SelectModel(Job->Raw, SampleSize, CostTable, Scratch->Candidates, SampleCosts);
+    
+    Job->ModelId = ModelId;
+    Job->StaticSaving = 0;
+    if (Job->StaticProb)
+    {
+        segment_cursor Rest = Job->Raw;
+        Rest.Advance(SampleSize);
+        u64 AdaptiveCost = SampleCosts[ModelId];
+        AdaptiveCost += EstimateWithModel(Rest, Job->RawSize - SampleSize, 
+                                          Scratch->Candidates + ModelId, CostTable);
         
-        Output = (u8 *)calloc(OutputSize, 1);
-        size_t Cursor = 0;
+        static_model StaticModel = {Job->StaticProb, 0};
+        u64 StaticCost = EstimateWithModel(Job->Raw, Job->RawSize, &StaticModel, CostTable);
+        if (StaticCost < AdaptiveCost)
+        {
+            Job->StaticSaving = (size_t)((AdaptiveCost - StaticCost) >> (ARITH_COST_FRACTION_BIT_COUNT + 3));
+        }
+    }
+}
+
+//NOTE(chen): codes the block with Job->ModelId, which is either an adaptive 
+//            config or ARITH_STATIC_MODEL_ID for the frame's static model
+void EncodeJob(job *Job, encode_scratch *Scratch)
+{
+    memory Encoded = {};
+    if (Job->ModelId == ARITH_STATIC_MODEL_ID)
+    {
+        static_model StaticModel = {Job->StaticProb, 0};
+        Encoded = EncodeWithModel(Job->Raw, Job->RawSize, &StaticModel, Job->ModelId);
+    }
+    else
+    {
+        Scratch->BlockModel.Init(ModelConfigs[Job->ModelId]);
+        Encoded = EncodeWithModel(Job->Raw, Job->RawSize, &Scratch->BlockModel, Job->ModelId);
+    }
+    Job->Encoded.Data = Encoded.Data;
+    Job->Encoded.Size = Encoded.Size;
+}
+
+//NOTE(chen): Model is the serialized static model, empty for adaptive frames
+size_t GetFrameSize(job *Jobs, size_t JobCount, memory Model)
+{
+    size_t FrameSize = 0;
+    FrameSize += sizeof(frame_header);
+    if (Model.Data)
+    {
+        FrameSize += sizeof(u32) + Model.Size;
+    }
+    FrameSize += sizeof(frame_block_entry) * JobCount;
+    for (size_t JobI = 0; JobI < JobCount; ++JobI)
+    {
+        FrameSize += Jobs[JobI].Encoded.Size;
+    }
+    
+    return FrameSize;
+}
+
+//NOTE(chen): writes GetFrameSize bytes, frees the jobs' encoded blocks
+void WriteFrame(u8 *Output, job *Jobs, size_t JobCount, memory Model)
+{
+    size_t Cursor = 0;
+    
+    WriteU32LE(Output+Cursor, ARITH_FRAME_MAGIC);
+    WriteU16LE(Output+Cursor+4, ARITH_FRAME_VERSION);
+    WriteU16LE(Output+Cursor+6, Model.Data? ARITH_FRAME_STATIC_MODEL: 0);
+    WriteU32LE(Output+Cursor+8, (u32)JobCount);
+    Cursor += sizeof(frame_header);
+    
+    if (Model.Data)
+    {
+        WriteU32LE(Output+Cursor, (u32)Model.Size);
+        Cursor += sizeof(u32);
+        memcpy(Output+Cursor, Model.Data, Model.Size);
+        Cursor += Model.Size;
+    }
+    
+    for (size_t JobI = 0; JobI < JobCount; ++JobI)
+    {
+        WriteU64LE(Output+Cursor, Jobs[JobI].RawSize);
+        WriteU64LE(Output+Cursor+8, Jobs[JobI].Encoded.Size);
+        Cursor += sizeof(frame_block_entry);
+    }
+    
+    for (size_t JobI = 0; JobI < JobCount; ++JobI)
+    {
+        job *Job = Jobs + JobI;
+        memcpy(Output+Cursor, Job->Encoded.Data, Job->Encoded.Size);
+        free(Job->Encoded.Data);
+        Cursor += Job->Encoded.Size;
+    }
+}
+
+//NOTE(chen): produces a single self-delimiting frame, see stream layout above.
+//            Blocks are cut at the same offsets as for a contiguous buffer, so 
+//            the output is identical to EncodeParallel on the joined segments
+//            
+//            StaticModel trades encode time for decode speed: a parallel first pass 
+//            gathers context statistics, the quantized model goes in the frame and
+//            blocks are coded with it frozen. Each block picks its own adaptive model 
+//            config by estimating a prefix with every candidate, in static frames 
+//            that config is only used when it beats the frame's model on the prefix.
+memory EncodeParallelSegments(memory *Segments, size_t SegmentCount, size_t BlockSize = MB(1), 
+                              bool StaticModel = false)
+{
+    size_t DataSize = GetSegmentsSize(Segments, SegmentCount);
+    size_t JobCount = GetBlockCount(DataSize, BlockSize);
+    job *Jobs = (job *)calloc(JobCount, sizeof(job));
+    BuildEncodeJobs(Jobs, Segments, SegmentCount, BlockSize);
+    
+    // nothing to model in an empty frame
+    if (JobCount == 0)
+    {
+        StaticModel = false;
+    }
+    
+    cost_table *CostTable = (cost_table *)calloc(1, sizeof(cost_table));
+    CostTable->Init();
+    
+    memory Model = {};
+    u16 *StaticProb = 0;
+    if (StaticModel)
+    {
+        // gather statistics over runs of whole blocks, one run per thread
+        size_t ContextCount = 1<<(1*ARITH_MODEL_ORDER);
+        size_t RunCount = Min(Max(std::thread::hardware_concurrency(), 1), JobCount);
+        size_t JobsPerRun = (JobCount + RunCount - 1) / RunCount;
+        u64 *RunCounts = (u64 *)calloc(RunCount * 2 * ContextCount, sizeof(u64));
         
-        *(size_t *)(Output+Cursor) = JobCount;
-        Cursor += sizeof(size_t);
-        size_t Offset = 0;
-        for (int JobI = 0; JobI < JobCount; ++JobI)
+        RunJobs(RunCount, [&](size_t RunIndex) {
+            u64 *Counts = RunCounts + RunIndex * 2 * ContextCount;
+            size_t OnePastLastJob = Min((RunIndex+1) * JobsPerRun, JobCount);
+            for (size_t JobI = RunIndex * JobsPerRun; JobI < OnePastLastJob; ++JobI)
+            {
+                CountContexts(Jobs[JobI].Raw, Jobs[JobI].RawSize, Counts);
+            }
+        });
+        
+        for (size_t RunI = 1; RunI < RunCount; ++RunI)
+        {
+            u64 *Counts = RunCounts + RunI * 2 * ContextCount;
+            for (size_t CountI = 0; CountI < 2 * ContextCount; ++CountI)
+            {
+                RunCounts[CountI] += Counts[CountI];
+            }
+        }
+        
+        Model = BuildStaticModel(RunCounts);
+        StaticProb = LoadStaticModel(Model.Data, Model.Size);
+        free(RunCounts);
+        
+        for (size_t JobI = 0; JobI < JobCount; ++JobI)
         {
-            size_t ChunkSize = Jobs[JobI].Output.Size;
-            *(size_t *)(Output+Cursor) = ChunkSize;
-            Offset += ChunkSize;
-            Cursor += sizeof(size_t);
+            Jobs[JobI].StaticProb = StaticProb;
+        }
+    }
+    
+    size_t WorkerCount = GetWorkerCount(JobCount);
+    encode_scratch *Scratches = (encode_scratch *)calloc(WorkerCount, sizeof(encode_scratch));
+    RunWorkerJobs(JobCount, [&](size_t JobIndex, size_t WorkerIndex) {
+        SelectJobModel(Jobs + JobIndex, CostTable, Scratches + WorkerIndex);
+    });
+    
+    // the model only goes in the frame if the blocks coded with it save more 
+    // than it takes up, otherwise every block stays adaptive
+    if (Model.Data)
+    {
+        size_t TotalSaving = 0;
+        for (size_t JobI = 0; JobI < JobCount; ++JobI)
+        {
+            TotalSaving += Jobs[JobI].StaticSaving;
         }
         
-        for (int JobI = 0; JobI < JobCount; ++JobI)
+        if (TotalSaving > sizeof(u32) + Model.Size)
         {
-            job *Job = Jobs + JobI;
-            memcpy(Output+Cursor, Job->Output.Data, Job->Output.Size);
-            free(Job->Output.Data);
-            Cursor += Job->Output.Size;
+            for (size_t JobI = 0; JobI < JobCount; ++JobI)
+            {
+                if (Jobs[JobI].StaticSaving)
+                {
+                    Jobs[JobI].ModelId = ARITH_STATIC_MODEL_ID;
+                }
+            }
+        }
+        else
+        {
+            free(Model.Data);
+            Model = {};
         }
     }
     
+    RunWorkerJobs(JobCount, [&](size_t JobIndex, size_t WorkerIndex) {
+        EncodeJob(Jobs + JobIndex, Scratches + WorkerIndex);
+    });
+    free(Scratches);
+    
+    // composite compressed data
+    size_t OutputSize = GetFrameSize(Jobs, JobCount, Model);
+    u8 *Output = (u8 *)calloc(OutputSize, 1);
+    WriteFrame(Output, Jobs, JobCount, Model);
+    
+    free(Model.Data);
+    free(StaticProb);
+    free(CostTable);
     free(Jobs);
     
     return {Output, OutputSize};
 }
 
-memory DecodeParallel(u8 *Data, size_t DataSize)
+memory EncodeParallel(u8 *Data, size_t DataSize, size_t BlockSize = MB(1), bool StaticModel = false)
 {
-    size_t *HeaderReader = (size_t *)Data;
-    size_t ChunkCount = *HeaderReader++;
-    Data += (1+ChunkCount) * sizeof(size_t);
+    memory Segment = {Data, DataSize};
+    return EncodeParallelSegments(&Segment, 1, BlockSize, StaticModel);
+}
+
+struct frame_info
+{
+    u16 Version;
+    u16 Flags;
+    u8 *Model;
+    size_t ModelSize;
+    u32 BlockCount;
+    u8 *BlockTable;
+    u8 *Payload;
+    size_t RawSize;
+    size_t FrameSize;
+};
+
+//NOTE(chen): returns false if Data doesn't start with a complete, valid frame
+bool ParseFrame(u8 *Data, size_t DataSize, frame_info *Info)
+{
+    if (DataSize < sizeof(frame_header)) return false;
+    if (ReadU32LE(Data) != ARITH_FRAME_MAGIC) return false;
+    u16 Version = ReadU16LE(Data+4);
+    if (Version < ARITH_FRAME_MIN_VERSION || Version > ARITH_FRAME_VERSION) return false;
+    
+    u16 Flags = ReadU16LE(Data+6);
+    if (Flags & ~ARITH_FRAME_KNOWN_FLAGS) return false;
     
-    // build a job for each chunk
-    job *Jobs = (job *)calloc(ChunkCount, sizeof(job));
-    size_t Offset = 0;
-    for (int ChunkI = 0; ChunkI < ChunkCount; ++ChunkI)
+    u32 BlockCount = ReadU32LE(Data+8);
+    size_t Cursor = sizeof(frame_header);
+    
+    Info->Version = Version;
+    Info->Flags = Flags;
+    if (Flags & ARITH_FRAME_STATIC_MODEL)
     {
-        size_t ChunkSize = *HeaderReader++;
+        if (DataSize - Cursor < sizeof(u32)) return false;
+        u32 ModelSize = ReadU32LE(Data+Cursor);
+        Cursor += sizeof(u32);
+        if (DataSize - Cursor < ModelSize) return false;
         
-        job *Job = Jobs + ChunkI;
-        Job->Input.Data = Data + Offset;
-        Job->Input.Size = ChunkSize;
-        Offset += ChunkSize;
+        Info->Model = Data + Cursor;
+        Info->ModelSize = ModelSize;
+        Cursor += ModelSize;
     }
     
-    size_t JobCount = ChunkCount;
-    std::atomic<size_t> NextJobIndex = 0;
+    if ((DataSize - Cursor) / sizeof(frame_block_entry) < BlockCount) return false;
     
-    auto WorkerFunc = [&]() {
-        size_t JobIndex = NextJobIndex.fetch_add(1);
-        while (JobIndex < JobCount)
+    Info->BlockCount = BlockCount;
+    Info->BlockTable = Data + Cursor;
+    Cursor += BlockCount * sizeof(frame_block_entry);
+    Info->Payload = Data + Cursor;
+    
+    Info->RawSize = 0;
+    for (u32 BlockI = 0; BlockI < BlockCount; ++BlockI)
+    {
+        u8 *Entry = Info->BlockTable + BlockI * sizeof(frame_block_entry);
+        u64 RawSize = ReadU64LE(Entry);
+        u64 EncodedSize = ReadU64LE(Entry+8);
+        if (EncodedSize > DataSize - Cursor) return false;
+        
+        // block header has to agree with the table, decoding trusts it
+        if (EncodedSize < GetBlockHeaderSize(Version)) return false;
+        header Header = ReadBlockHeader(Data+Cursor, Version);
+        if (Header.EncodedByteCount != RawSize) return false;
+        if (!IsStaticBlock(Flags, Version, Header) && 
+            Header.ModelId >= ARITH_MODEL_CONFIG_COUNT) return false;
+        
+        Info->RawSize += RawSize;
+        Cursor += EncodedSize;
+    }
+    Info->FrameSize = Cursor;
+    
+    return true;
+}
+
+struct stream_info
+{
+    size_t FrameCount;
+    size_t BlockCount;
+    size_t DecodedSize;
+};
+
+//NOTE(chen): walks every frame of a stream, returns false if it's malformed
+bool ScanStream(u8 *Data, size_t DataSize, stream_info *Info)
+{
+    *Info = {};
+    for (size_t Cursor = 0; Cursor < DataSize;)
+    {
+        frame_info Frame = {};
+        if (!ParseFrame(Data+Cursor, DataSize-Cursor, &Frame))
+        {
+            return false;
+        }
+        
+        Info->FrameCount += 1;
+        Info->BlockCount += Frame.BlockCount;
+        Info->DecodedSize += Frame.RawSize;
+        Cursor += Frame.FrameSize;
+    }
+    
+    return true;
+}
+
+//NOTE(chen): total decoded size of every frame in the stream, 
+//            returns false if the stream is malformed
+bool GetDecodedSize(u8 *Data, size_t DataSize, size_t *DecodedSize)
+{
+    stream_info Stream = {};
+    bool Valid = ScanStream(Data, DataSize, &Stream);
+    *DecodedSize = Stream.DecodedSize;
+    return Valid;
+}
+
+//NOTE(chen): a job per block of an already scanned stream, decoding into Output.
+//            Static model frames get their table expanded once into StaticProbs,
+//            one slot per frame. Returns false if a static model is malformed
+bool BuildDecodeJobs(u8 *Data, size_t DataSize, segment_cursor Output, job *Jobs, u16 **StaticProbs)
+{
+    size_t NextJob = 0;
+    size_t FrameI = 0;
+    for (size_t Cursor = 0; Cursor < DataSize; ++FrameI)
+    {
+        frame_info Frame = {};
+        ParseFrame(Data+Cursor, DataSize-Cursor, &Frame);
+        
+        u16 *StaticProb = 0;
+        if (Frame.Flags & ARITH_FRAME_STATIC_MODEL)
         {
-            job *Job = Jobs + JobIndex;
+            StaticProb = LoadStaticModel(Frame.Model, Frame.ModelSize, Frame.Version);
+            StaticProbs[FrameI] = StaticProb;
+            if (!StaticProb)
+            {
+                return false;
+            }
+        }
+        
+        size_t Offset = 0;
+        for (u32 BlockI = 0; BlockI < Frame.BlockCount; ++BlockI)
+        {
+            u8 *Entry = Frame.BlockTable + BlockI * sizeof(frame_block_entry);
+            size_t RawSize = ReadU64LE(Entry);
+            size_t EncodedSize = ReadU64LE(Entry+8);
             
-            memory Decoded = Decode(Job->Input.Data, Job->Input.Size);
-            Job->Output.Data = Decoded.Data;
-            Job->Output.Size = Decoded.Size;
+            job *Job = Jobs + NextJob++;
+            Job->Raw = Output;
+            Job->RawSize = RawSize;
+            Job->Encoded.Data = Frame.Payload + Offset;
+            Job->Encoded.Size = EncodedSize;
+            Job->Version = Frame.Version;
             
-            JobIndex = NextJobIndex.fetch_add(1);
+            header Header = ReadBlockHeader(Job->Encoded.Data, Frame.Version);
+            if (IsStaticBlock(Frame.Flags, Frame.Version, Header))
+            {
+                Job->StaticProb = StaticProb;
+            }
+            
+            Output.Advance(RawSize);
+            Offset += EncodedSize;
         }
-    };
+        
+        Cursor += Frame.FrameSize;
+    }
     
-    // spin up workers
-    int WorkerCount = std::thread::hardware_concurrency() - 1;
-    std::thread *Workers = (std::thread *)calloc(WorkerCount, sizeof(std::thread));
-    for (int WorkerI = 0; WorkerI < WorkerCount; ++WorkerI)
+    return true;
+}
+
+void DecodeJob(job *Job)
+{
+    if (Job->StaticProb)
+    {
+        static_model BlockModel = {Job->StaticProb, 0};
+        DecodeWithModel(Job->Encoded.Data, Job->Encoded.Size, Job->Raw, &BlockModel, Job->Version);
+    }
+    else
     {
-        Workers[WorkerI] = std::thread(WorkerFunc);
+        DecodeSegments(Job->Encoded.Data, Job->Encoded.Size, Job->Raw, Job->Version);
+    }
+}
+
+//NOTE(chen): decodes every frame of a (possibly appended-to) stream straight into
+//            the caller's segments, blocks of all frames are scheduled on the same
+//            worker pool. Fails if the stream is malformed or the segments are too small
+bool DecodeParallelSegments(u8 *Data, size_t DataSize, memory *Segments, size_t SegmentCount)
+{
+    stream_info Stream = {};
+    if (!ScanStream(Data, DataSize, &Stream))
+    {
+        return false;
     }
-    WorkerFunc();
     
-    // block until jobs are done
-    for (int WorkerI = 0; WorkerI < WorkerCount; ++WorkerI)
+    if (Stream.DecodedSize > GetSegmentsSize(Segments, SegmentCount))
     {
-        Workers[WorkerI].join();
+        return false;
+    }
+    
+    job *Jobs = (job *)calloc(Stream.BlockCount, sizeof(job));
+    u16 **StaticProbs = (u16 **)calloc(Stream.FrameCount, sizeof(u16 *));
+    segment_cursor Output = {Segments, SegmentCount};
+    
+    bool Valid = BuildDecodeJobs(Data, DataSize, Output, Jobs, StaticProbs);
+    if (Valid)
+    {
+        RunJobs(Stream.BlockCount, [&](size_t JobIndex) {
+            DecodeJob(Jobs + JobIndex);
+        });
+    }
+    
+    for (size_t FrameI = 0; FrameI < Stream.FrameCount; ++FrameI)
+    {
+        free(StaticProbs[FrameI]);
     }
+    free(StaticProbs);
+    free(Jobs);
     
-    // composite decompressed data
-    size_t OutputSize = 0;
-    u8 *Output = 0;
+    return Valid;
+}
+
+//NOTE(chen): returns {} on a malformed stream, Data is never null on success
+//            so an empty stream can be told apart from a failure
+memory DecodeParallel(u8 *Data, size_t DataSize)
+{
+    memory Segment = {};
+    if (!GetDecodedSize(Data, DataSize, &Segment.Size))
     {
-        OutputSize = 0;
-        for (int JobI = 0; JobI < JobCount; ++JobI)
+        return {};
+    }
+    
+    Segment.Data = (u8 *)calloc(Max(Segment.Size, 1), 1);
+    if (!DecodeParallelSegments(Data, DataSize, &Segment, 1))
+    {
+        free(Segment.Data);
+        return {};
+    }
+    
+    return Segment;
+}
+
+//NOTE(chen): state kept between low latency decodes, not to be shared across threads
+struct decode_context
+{
+    lazy_model *Model;
+};
+
+decode_context CreateDecodeContext()
+{
+    decode_context Context = {};
+    Context.Model = (lazy_model *)calloc(1, sizeof(lazy_model));
+    return Context;
+}
+
+void FreeDecodeContext(decode_context *Context)
+{
+    free(Context->Model);
+    Context->Model = 0;
+}
+
+//NOTE(chen): decode path for small messages in a request path. Everything runs 
+//            on the calling thread, nothing gets allocated for adaptive frames and 
+//            the model is reused across calls through the context's epoch instead 
+//            of being cleared. Same failure cases as DecodeParallelSegments
+bool DecodeLowLatency(decode_context *Context, u8 *Data, size_t DataSize, 
+                      memory *Segments, size_t SegmentCount)
+{
+    stream_info Stream = {};
+    if (!ScanStream(Data, DataSize, &Stream))
+    {
+        return false;
+    }
+    
+    if (Stream.DecodedSize > GetSegmentsSize(Segments, SegmentCount))
+    {
+        return false;
+    }
+    
+    segment_cursor Output = {Segments, SegmentCount};
+    for (size_t Cursor = 0; Cursor < DataSize;)
+    {
+        frame_info Frame = {};
+        ParseFrame(Data+Cursor, DataSize-Cursor, &Frame);
+        
+        // static model frames aren't what this path is for, but still decode them
+        u16 *StaticProb = 0;
+        if (Frame.Flags & ARITH_FRAME_STATIC_MODEL)
         {
-            OutputSize += Jobs[JobI].Output.Size;
+            StaticProb = LoadStaticModel(Frame.Model, Frame.ModelSize, Frame.Version);
+            if (!StaticProb)
+            {
+                return false;
+            }
         }
         
-        Output = (u8 *)calloc(OutputSize, 1);
-        size_t Cursor = 0;
-        for (int JobI = 0; JobI < JobCount; ++JobI)
+        size_t Offset = 0;
+        for (u32 BlockI = 0; BlockI < Frame.BlockCount; ++BlockI)
         {
-            job *Job = Jobs + JobI;
-            memcpy(Output+Cursor, Job->Output.Data, Job->Output.Size);
-            free(Job->Output.Data);
-            Cursor += Job->Output.Size;
+            u8 *Entry = Frame.BlockTable + BlockI * sizeof(frame_block_entry);
+            size_t RawSize = ReadU64LE(Entry);
+            size_t EncodedSize = ReadU64LE(Entry+8);
+            u8 *Bits = Frame.Payload + Offset;
+            
+            header Header = ReadBlockHeader(Bits, Frame.Version);
+            if (IsStaticBlock(Frame.Flags, Frame.Version, Header))
+            {
+                static_model BlockModel = {StaticProb, 0};
+                DecodeWithModel(Bits, EncodedSize, Output, &BlockModel, Frame.Version);
+            }
+            else
+            {
+                Context->Model->Init(ModelConfigs[Header.ModelId]);
+                DecodeWithModel(Bits, EncodedSize, Output, Context->Model, Frame.Version);
+            }
+            
+            Output.Advance(RawSize);
+            Offset += EncodedSize;
         }
+        
+        free(StaticProb);
+        Cursor += Frame.FrameSize;
     }
     
+    return true;
+}
+
+//NOTE(chen): predicts EncodeParallelSegments' output size without doing any 
+//            interval arithmetic or bit output, blocks are estimated in parallel.
+//            SampleSize, if non-zero, caps how much of each block gets modeled
+size_t EstimateEncodedSizeSegments(memory *Segments, size_t SegmentCount, size_t BlockSize = MB(1), 
+                                   size_t SampleSize = 0)
+{
+    size_t DataSize = GetSegmentsSize(Segments, SegmentCount);
+    size_t JobCount = GetBlockCount(DataSize, BlockSize);
+    job *Jobs = (job *)calloc(JobCount, sizeof(job));
+    BuildEncodeJobs(Jobs, Segments, SegmentCount, BlockSize);
+    
+    cost_table *CostTable = (cost_table *)calloc(1, sizeof(cost_table));
+    CostTable->Init();
+    
+    size_t WorkerCount = GetWorkerCount(JobCount);
+    encode_scratch *Scratches = (encode_scratch *)calloc(WorkerCount, sizeof(encode_scratch));
+    RunWorkerJobs(JobCount, [&](size_t JobIndex, size_t WorkerIndex) {
+        job *Job = Jobs + JobIndex;
+        lazy_model *Models = Scratches[WorkerIndex].Candidates;
+        Job->Encoded.Size = EstimateSegments(Job->Raw, Job->RawSize, CostTable, Models, SampleSize);
+    });
+    free(Scratches);
+    
+    size_t EstimatedSize = sizeof(frame_header) + JobCount * sizeof(frame_block_entry);
+    for (size_t JobI = 0; JobI < JobCount; ++JobI)
+    {
+        EstimatedSize += Jobs[JobI].Encoded.Size;
+    }
+    
+    free(CostTable);
     free(Jobs);
     
+    return EstimatedSize;
+}
+
+size_t EstimateEncodedSize(u8 *Data, size_t DataSize, size_t BlockSize = MB(1), size_t SampleSize = 0)
+{
+    memory Segment = {Data, DataSize};
+    return EstimateEncodedSizeSegments(&Segment, 1, BlockSize, SampleSize);
+}
+
+/*NOTE(chen):
+
+archive layout, all fields little-endian:
+
+    archive_header
+    FileCount * index entry:
+        u16 NameSize
+        u8 Name[NameSize]
+        u64 RawSize
+        u64 StreamOffset    from the start of the archive
+        u64 StreamSize
+    FileCount * frame stream, one per file
+
+Every file is a regular stream, so a single file can also be pulled out with 
+DecodeParallel on its StreamOffset/StreamSize range.
+
+*/
+
+#define ARITH_ARCHIVE_MAGIC 0x41435241 // "ARCA"
+#define ARITH_ARCHIVE_VERSION 1
+#define ARITH_ARCHIVE_KNOWN_FLAGS 0 // none defined yet
+#define ARITH_ARCHIVE_MAX_NAME_SIZE 0xFFFF // has to fit the index entry's u16
+
+#pragma pack(push, 1)
+struct archive_header
+{
+    u32 Magic;
+    u16 Version;
+    u16 Flags;
+    u32 FileCount;
+};
+#pragma pack(pop)
+
+struct archive_file
+{
+    char *Name;
+    memory Data;
+};
+
+struct archive_entry
+{
+    memory Name; // not null-terminated, points into the archive
+    size_t RawSize;
+    memory Stream;
+};
+
+//NOTE(chen): blocks of every file are scheduled on one worker pool, so many 
+//            small files still keep all cores busy.
+//            Returns {} if a name is longer than ARITH_ARCHIVE_MAX_NAME_SIZE
+memory EncodeArchive(archive_file *Files, size_t FileCount, size_t BlockSize = MB(1))
+{
+    for (size_t FileI = 0; FileI < FileCount; ++FileI)
+    {
+        if (strlen(Files[FileI].Name) > ARITH_ARCHIVE_MAX_NAME_SIZE) return {};
+    }
+    
+    size_t *FirstJobs = (size_t *)calloc(FileCount + 1, sizeof(size_t));
+    for (size_t FileI = 0; FileI < FileCount; ++FileI)
+    {
+        FirstJobs[FileI+1] = FirstJobs[FileI] + GetBlockCount(Files[FileI].Data.Size, BlockSize);
+    }
+    
+    size_t JobCount = FirstJobs[FileCount];
+    job *Jobs = (job *)calloc(JobCount, sizeof(job));
+    for (size_t FileI = 0; FileI < FileCount; ++FileI)
+    {
+        BuildEncodeJobs(Jobs + FirstJobs[FileI], &Files[FileI].Data, 1, BlockSize);
+    }
+    
+    cost_table *CostTable = (cost_table *)calloc(1, sizeof(cost_table));
+    CostTable->Init();
+    
+    size_t WorkerCount = GetWorkerCount(JobCount);
+    encode_scratch *Scratches = (encode_scratch *)calloc(WorkerCount, sizeof(encode_scratch));
+    RunWorkerJobs(JobCount, [&](size_t JobIndex, size_t WorkerIndex) {
+        SelectJobModel(Jobs + JobIndex, CostTable, Scratches + WorkerIndex);
+        EncodeJob(Jobs + JobIndex, Scratches + WorkerIndex);
+    });
+    free(Scratches);
+    
+    // composite archive
+    memory NoModel = {};
+    size_t IndexSize = 0;
+    size_t OutputSize = sizeof(archive_header);
+    for (size_t FileI = 0; FileI < FileCount; ++FileI)
+    {
+        IndexSize += sizeof(u16) + strlen(Files[FileI].Name) + 3*sizeof(u64);
+    }
+    OutputSize += IndexSize;
+    for (size_t FileI = 0; FileI < FileCount; ++FileI)
+    {
+        size_t FileJobCount = FirstJobs[FileI+1] - FirstJobs[FileI];
+        OutputSize += GetFrameSize(Jobs + FirstJobs[FileI], FileJobCount, NoModel);
+    }
+    
+    u8 *Output = (u8 *)calloc(OutputSize, 1);
+    WriteU32LE(Output, ARITH_ARCHIVE_MAGIC);
+    WriteU16LE(Output+4, ARITH_ARCHIVE_VERSION);
+    WriteU16LE(Output+6, 0);
+    WriteU32LE(Output+8, (u32)FileCount);
+    
+    size_t IndexCursor = sizeof(archive_header);
+    size_t StreamCursor = IndexCursor + IndexSize;
+    for (size_t FileI = 0; FileI < FileCount; ++FileI)
+    {
+        job *FileJobs = Jobs + FirstJobs[FileI];
+        size_t FileJobCount = FirstJobs[FileI+1] - FirstJobs[FileI];
+        size_t StreamSize = GetFrameSize(FileJobs, FileJobCount, NoModel);
+        
+        size_t NameSize = strlen(Files[FileI].Name);
+        WriteU16LE(Output+IndexCursor, (u16)NameSize);
+        IndexCursor += sizeof(u16);
+        memcpy(Output+IndexCursor, Files[FileI].Name, NameSize);
+        IndexCursor += NameSize;
+        WriteU64LE(Output+IndexCursor, Files[FileI].Data.Size);
+        WriteU64LE(Output+IndexCursor+8, StreamCursor);
+        WriteU64LE(Output+IndexCursor+16, StreamSize);
+        IndexCursor += 3*sizeof(u64);
+        
+        WriteFrame(Output+StreamCursor, FileJobs, FileJobCount, NoModel);
+        StreamCursor += StreamSize;
+    }
+    
+    free(CostTable);
+    free(Jobs);
+    free(FirstJobs);
+    
     return {Output, OutputSize};
 }
+
+//NOTE(chen): parses the file index, Entries is allocated and must be freed by 
+//            the caller. Returns false if the archive is malformed
+bool ReadArchiveIndex(u8 *Data, size_t DataSize, archive_entry **Entries, size_t *EntryCount)
+{
+    *Entries = 0;
+    *EntryCount = 0;
+    
+    if (DataSize < sizeof(archive_header)) return false;
+    if (ReadU32LE(Data) != ARITH_ARCHIVE_MAGIC) return false;
+    if (ReadU16LE(Data+4) != ARITH_ARCHIVE_VERSION) return false;
+    if (ReadU16LE(Data+6) & ~ARITH_ARCHIVE_KNOWN_FLAGS) return false;
+    
+    // every index entry takes at least this much, so a bogus count can't make us allocate
+    size_t FileCount = ReadU32LE(Data+8);
+    size_t MinEntrySize = sizeof(u16) + 3*sizeof(u64);
+    if (FileCount > (DataSize - sizeof(archive_header)) / MinEntrySize) return false;
+    
+    archive_entry *Result = (archive_entry *)calloc(FileCount, sizeof(archive_entry));
+    
+    size_t Cursor = sizeof(archive_header);
+    for (size_t FileI = 0; FileI < FileCount; ++FileI)
+    {
+        archive_entry *Entry = Result + FileI;
+        
+        if (DataSize - Cursor < sizeof(u16)) break;
+        size_t NameSize = ReadU16LE(Data+Cursor);
+        Cursor += sizeof(u16);
+        
+        if (DataSize - Cursor < NameSize + 3*sizeof(u64)) break;
+        Entry->Name = {Data+Cursor, NameSize};
+        Cursor += NameSize;
+        
+        size_t StreamOffset = ReadU64LE(Data+Cursor+8);
+        size_t StreamSize = ReadU64LE(Data+Cursor+16);
+        if (StreamOffset > DataSize || StreamSize > DataSize - StreamOffset) break;
+        
+        Entry->RawSize = ReadU64LE(Data+Cursor);
+        Entry->Stream = {Data+StreamOffset, StreamSize};
+        Cursor += 3*sizeof(u64);
+        
+        *EntryCount += 1;
+    }
+    
+    if (*EntryCount != FileCount)
+    {
+        free(Result);
+        *EntryCount = 0;
+        return false;
+    }
+    
+    *Entries = Result;
+    return true;
+}
+
+//NOTE(chen): decodes any subset of an archive's entries, blocks of all of them 
+//            share one worker pool. Outputs[I] gets a freshly allocated buffer for 
+//            Entries[I]. Returns false, with no outputs, if any entry is malformed
+bool ExtractArchive(archive_entry *Entries, size_t EntryCount, memory *Outputs)
+{
+    size_t JobCount = 0;
+    size_t FrameCount = 0;
+    for (size_t EntryI = 0; EntryI < EntryCount; ++EntryI)
+    {
+        archive_entry *Entry = Entries + EntryI;
+        stream_info Stream = {};
+        if (!ScanStream(Entry->Stream.Data, Entry->Stream.Size, &Stream) ||
+            Stream.DecodedSize != Entry->RawSize)
+        {
+            return false;
+        }
+        
+        JobCount += Stream.BlockCount;
+        FrameCount += Stream.FrameCount;
+    }
+    
+    job *Jobs = (job *)calloc(JobCount, sizeof(job));
+    u16 **StaticProbs = (u16 **)calloc(FrameCount, sizeof(u16 *));
+    size_t NextJob = 0;
+    size_t NextFrame = 0;
+    bool Valid = true;
+    for (size_t EntryI = 0; EntryI < EntryCount; ++EntryI)
+    {
+        archive_entry *Entry = Entries + EntryI;
+        Outputs[EntryI].Size = Entry->RawSize;
+        Outputs[EntryI].Data = (u8 *)calloc(Entry->RawSize, 1);
+        
+        stream_info Stream = {};
+        ScanStream(Entry->Stream.Data, Entry->Stream.Size, &Stream);
+        
+        segment_cursor Output = {Outputs + EntryI, 1};
+        if (!BuildDecodeJobs(Entry->Stream.Data, Entry->Stream.Size, Output, 
+                             Jobs + NextJob, StaticProbs + NextFrame))
+        {
+            Valid = false;
+        }
+        
+        NextJob += Stream.BlockCount;
+        NextFrame += Stream.FrameCount;
+    }
+    
+    if (Valid)
+    {
+        RunJobs(JobCount, [&](size_t JobIndex) {
+            DecodeJob(Jobs + JobIndex);
+        });
+    }
+    else
+    {
+        for (size_t EntryI = 0; EntryI < EntryCount; ++EntryI)
+        {
+            free(Outputs[EntryI].Data);
+            Outputs[EntryI] = {};
+        }
+    }
+    
+    for (size_t FrameI = 0; FrameI < FrameCount; ++FrameI)
+    {
+        free(StaticProbs[FrameI]);
+    }
+    free(StaticProbs);
+    free(Jobs);
+    
+    return Valid;
+}
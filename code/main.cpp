@@ -5,12 +5,44 @@
 #include <string.h>
 #include <stdio.h>
 #include <time.h>
+#include <chrono>
+
+#ifdef _WIN32
+#include <direct.h>
+#define MakeDirectory(Path) _mkdir(Path)
+#else
+#include <sys/stat.h>
+#define MakeDirectory(Path) mkdir(Path, 0777)
+#endif
 
 float GetTimeElapsed(clock_t BeginTick, clock_t EndTick)
 {
     return f32(EndTick - BeginTick) / f32(CLOCKS_PER_SEC);
 }
 
+//NOTE(chen): clock() ticks in milliseconds on some platforms, too coarse 
+//            to time a single small message
+f64 GetMicroseconds()
+{
+    auto SinceEpoch = std::chrono::steady_clock::now().time_since_epoch();
+    return f64(std::chrono::duration_cast<std::chrono::nanoseconds>(SinceEpoch).count()) / 1000.0;
+}
+
+int CompareF64(const void *A, const void *B)
+{
+    f64 ValueA = *(f64 *)A;
+    f64 ValueB = *(f64 *)B;
+    return (ValueA > ValueB) - (ValueA < ValueB);
+}
+
+// nearest rank, sorts Samples
+f64 GetPercentile(f64 *Samples, int SampleCount, int Percent)
+{
+    qsort(Samples, SampleCount, sizeof(f64), CompareF64);
+    int Rank = (SampleCount * Percent + 99) / 100;
+    return Samples[Rank > 0? Rank - 1: 0];
+}
+
 memory ReadEntireFile(char *Filename)
 {
     memory Result = {};
@@ -29,13 +61,46 @@ memory ReadEntireFile(char *Filename)
     return Result;
 }
 
-void WriteEntireFile(char *Filename, void *Data, size_t Size)
+bool WriteEntireFile(char *Filename, void *Data, size_t Size)
 {
+    bool Written = false;
+    
     FILE *File = fopen(Filename, "wb");
     if (File)
     {
-        fwrite(Data, 1, Size, File);
-        fclose(File);
+        Written = fwrite(Data, 1, Size, File) == Size;
+        Written = (fclose(File) == 0) && Written;
+    }
+    
+    return Written;
+}
+
+bool AppendToFile(char *Filename, void *Data, size_t Size)
+{
+    bool Written = false;
+    
+    FILE *File = fopen(Filename, "ab");
+    if (File)
+    {
+        Written = fwrite(Data, 1, Size, File) == Size;
+        Written = (fclose(File) == 0) && Written;
+    }
+    
+    return Written;
+}
+
+//NOTE(chen): creates every directory on the way to Filename, existing ones are fine.
+//            Anything that goes wrong shows up when the file itself gets written
+void CreateParentDirectories(char *Filename)
+{
+    for (char *Cursor = Filename; *Cursor; ++Cursor)
+    {
+        if (*Cursor == '/')
+        {
+            *Cursor = 0;
+            MakeDirectory(Filename);
+            *Cursor = '/';
+        }
     }
 }
 
@@ -60,22 +125,41 @@ void Benchmark()
     clock_t EndTick = clock();
     printf("file loading time: %.2fs\n", GetTimeElapsed(BeginTick, EndTick));
     
-    // parallel compression test & benchmark
+    // size estimation benchmark
     {
         BeginTick = clock();
-        memory EncodedData = EncodeParallel(Data, DataSize);
+        size_t EstimatedSize = EstimateEncodedSize(Data, DataSize);
+        EndTick = clock();
+        
+        printf("size estimation time: %.2fs, estimated compression ratio: %.5f\n", 
+               GetTimeElapsed(BeginTick, EndTick), f32(DataSize)/f32(EstimatedSize));
+    }
+    
+    // parallel compression test & benchmark, adaptive and static model
+    for (int StaticModel = 0; StaticModel < 2; ++StaticModel)
+    {
+        const char *Mode = StaticModel? "static": "adaptive";
+        
+        BeginTick = clock();
+        memory EncodedData = EncodeParallel(Data, DataSize, MB(1), StaticModel != 0);
         EndTick = clock();
         
         f32 ParallelCompressionTime = GetTimeElapsed(BeginTick, EndTick);
-        printf("parallel compression time: %.2fs, parallel compression ratio: %.5f\n", 
-               ParallelCompressionTime, f32(DataSize)/f32(EncodedData.Size));
+        printf("%s parallel compression time: %.2fs, parallel compression ratio: %.5f\n", 
+               Mode, ParallelCompressionTime, f32(DataSize)/f32(EncodedData.Size));
         
         BeginTick = clock();
         memory DecodedData = DecodeParallel(EncodedData.Data, EncodedData.Size);
         EndTick = clock();
         
+        if (!DecodedData.Data)
+        {
+            printf("%s parallel decompression failed\n", Mode);
+            return;
+        }
+        
         f32 ParallelDecompressionTime = GetTimeElapsed(BeginTick, EndTick);
-        printf("parallel decompression time: %.2fs\n", ParallelDecompressionTime);
+        printf("%s parallel decompression time: %.2fs\n", Mode, ParallelDecompressionTime);
         
         size_t CorrectByteCount = 0;
         for (size_t ByteI = 0; ByteI < DataSize; ++ByteI)
@@ -85,10 +169,89 @@ void Benchmark()
                 CorrectByteCount += 1;
             }
         }
-        printf("accuracy: %zu/%zu\n", CorrectByteCount, DataSize);
+        printf("%s accuracy: %zu/%zu\n", Mode, CorrectByteCount, DataSize);
+        
+        printf("%s parallel compression speed: %.2fmb/s\n", Mode, f32(DataSize)/f32(1024*1024)/ParallelCompressionTime);
+        printf("%s parallel decompression speed: %.2fmb/s\n", Mode, f32(DataSize)/f32(1024*1024)/ParallelDecompressionTime);
+        
+        free(DecodedData.Data);
+        free(EncodedData.Data);
+    }
+    
+    // static frames only keep their model when it pays for itself, so they should 
+    // never come out larger than adaptive ones. Small inputs are where it costs most
+    {
+        size_t CheckSizes[] = {Min(KB(64), DataSize), DataSize};
+        for (int CheckI = 0; CheckI < 2; ++CheckI)
+        {
+            size_t CheckSize = CheckSizes[CheckI];
+            memory Adaptive = EncodeParallel(Data, CheckSize);
+            memory Static = EncodeParallel(Data, CheckSize, MB(1), true);
+            
+            bool Larger = Static.Size > Adaptive.Size + Adaptive.Size / 100;
+            printf("%zu bytes, static vs adaptive size: %zu vs %zu%s\n", CheckSize, 
+                   Static.Size, Adaptive.Size, Larger? ", STATIC IS LARGER": "");
+            
+            free(Static.Data);
+            free(Adaptive.Data);
+        }
+    }
+    
+    // small message decode latency benchmark, every iteration is timed and checked
+    {
+        size_t MessageSize = Min(KB(4), DataSize);
+        int Iterations = 1000;
+        memory EncodedMessage = EncodeParallel(Data, MessageSize);
+        f64 *ParallelSamples = (f64 *)calloc(Iterations, sizeof(f64));
+        f64 *LowLatencySamples = (f64 *)calloc(Iterations, sizeof(f64));
+        int MismatchCount = 0;
+        
+        for (int IterationI = 0; IterationI < Iterations; ++IterationI)
+        {
+            f64 Begin = GetMicroseconds();
+            memory DecodedMessage = DecodeParallel(EncodedMessage.Data, EncodedMessage.Size);
+            ParallelSamples[IterationI] = GetMicroseconds() - Begin;
+            
+            if (DecodedMessage.Size != MessageSize || 
+                memcmp(DecodedMessage.Data, Data, MessageSize) != 0)
+            {
+                MismatchCount += 1;
+            }
+            free(DecodedMessage.Data);
+        }
+        
+        decode_context Context = CreateDecodeContext();
+        u8 *MessageOutput = (u8 *)calloc(MessageSize, 1);
+        memory Segment = {MessageOutput, MessageSize};
+        
+        for (int IterationI = 0; IterationI < Iterations; ++IterationI)
+        {
+            memset(MessageOutput, 0, MessageSize);
+            
+            f64 Begin = GetMicroseconds();
+            bool Decoded = DecodeLowLatency(&Context, EncodedMessage.Data, EncodedMessage.Size, &Segment, 1);
+            LowLatencySamples[IterationI] = GetMicroseconds() - Begin;
+            
+            if (!Decoded || memcmp(MessageOutput, Data, MessageSize) != 0)
+            {
+                MismatchCount += 1;
+            }
+        }
+        
+        f64 ParallelP50 = GetPercentile(ParallelSamples, Iterations, 50);
+        f64 ParallelP99 = GetPercentile(ParallelSamples, Iterations, 99);
+        f64 LowLatencyP50 = GetPercentile(LowLatencySamples, Iterations, 50);
+        f64 LowLatencyP99 = GetPercentile(LowLatencySamples, Iterations, 99);
+        printf("%zu byte message decode latency: parallel p50 %.1fus p99 %.1fus, "
+               "low latency p50 %.1fus p99 %.1fus\n", MessageSize, 
+               ParallelP50, ParallelP99, LowLatencyP50, LowLatencyP99);
+        printf("message accuracy: %d/%d decodes wrong\n", MismatchCount, 2*Iterations);
         
-        printf("parallel compression speed: %.2fmb/s\n", f32(DataSize)/f32(1024*1024)/ParallelCompressionTime);
-        printf("parallel decompression speed: %.2fmb/s\n", f32(DataSize)/f32(1024*1024)/ParallelDecompressionTime);
+        FreeDecodeContext(&Context);
+        free(MessageOutput);
+        free(LowLatencySamples);
+        free(ParallelSamples);
+        free(EncodedMessage.Data);
     }
 }
 
@@ -97,25 +260,273 @@ bool StringEqual(char *A, char *B)
     return strcmp(A, B) == 0;
 }
 
+void PrintUsage()
+{
+    printf("usage: arith_coder.exe [-encode/-encode-static/-append/-decode] [input file] [output file]\n");
+    printf("       arith_coder.exe -archive [archive file] [input files...]\n");
+    printf("       arith_coder.exe -extract [archive file] [file names to extract, all if none]\n");
+    printf("       arith_coder.exe -benchmark\n");
+}
+
+//NOTE(chen): archives store names relative to wherever they get extracted, 
+//            separated by '/'. Drive letters, leading slashes and "." components
+//            are dropped, ".." removes the previous component or is dropped if 
+//            there is none. Returns a new string, empty if nothing is left
+char *NormalizeArchiveName(char *Filename)
+{
+    char *Result = (char *)calloc(strlen(Filename) + 1, 1);
+    size_t ResultSize = 0;
+    
+    char *Cursor = Filename;
+    if (Cursor[0] && Cursor[1] == ':')
+    {
+        Cursor += 2;
+    }
+    
+    while (*Cursor)
+    {
+        char *Component = Cursor;
+        while (*Cursor && *Cursor != '/' && *Cursor != '\\')
+        {
+            ++Cursor;
+        }
+        size_t ComponentSize = Cursor - Component;
+        if (*Cursor)
+        {
+            ++Cursor;
+        }
+        
+        if (ComponentSize == 0 || (ComponentSize == 1 && Component[0] == '.'))
+        {
+            continue;
+        }
+        
+        if (ComponentSize == 2 && Component[0] == '.' && Component[1] == '.')
+        {
+            while (ResultSize > 0 && Result[ResultSize-1] != '/')
+            {
+                --ResultSize;
+            }
+            if (ResultSize > 0)
+            {
+                --ResultSize;
+            }
+            continue;
+        }
+        
+        if (ResultSize > 0)
+        {
+            Result[ResultSize++] = '/';
+        }
+        memcpy(Result + ResultSize, Component, ComponentSize);
+        ResultSize += ComponentSize;
+    }
+    Result[ResultSize] = 0;
+    
+    return Result;
+}
+
+int ArchiveFiles(char *ArchiveFilename, char **Filenames, int FileCount)
+{
+    archive_file *Files = (archive_file *)calloc(FileCount, sizeof(archive_file));
+    for (int FileI = 0; FileI < FileCount; ++FileI)
+    {
+        Files[FileI].Name = NormalizeArchiveName(Filenames[FileI]);
+        if (!Files[FileI].Name[0])
+        {
+            printf("can't archive %s, no file name left after making it relative\n", Filenames[FileI]);
+            return -1;
+        }
+        if (strlen(Files[FileI].Name) > ARITH_ARCHIVE_MAX_NAME_SIZE)
+        {
+            printf("can't archive %s, name is longer than %d bytes\n", Filenames[FileI], 
+                   ARITH_ARCHIVE_MAX_NAME_SIZE);
+            return -1;
+        }
+        
+        Files[FileI].Data = ReadEntireFile(Filenames[FileI]);
+        if (!Files[FileI].Data.Data)
+        {
+            printf("couldn't read %s\n", Filenames[FileI]);
+            return -1;
+        }
+    }
+    
+    memory Archive = EncodeArchive(Files, FileCount);
+    if (!WriteEntireFile(ArchiveFilename, Archive.Data, Archive.Size))
+    {
+        printf("couldn't write %s\n", ArchiveFilename);
+        return -1;
+    }
+    
+    for (int FileI = 0; FileI < FileCount; ++FileI)
+    {
+        free(Files[FileI].Name);
+        free(Files[FileI].Data.Data);
+    }
+    free(Files);
+    free(Archive.Data);
+    
+    return 0;
+}
+
+int ExtractFiles(char *ArchiveFilename, char **Filenames, int FileCount)
+{
+    memory Archive = ReadEntireFile(ArchiveFilename);
+    if (!Archive.Data)
+    {
+        printf("couldn't read %s\n", ArchiveFilename);
+        return -1;
+    }
+    
+    archive_entry *Entries = 0;
+    size_t EntryCount = 0;
+    if (!ReadArchiveIndex(Archive.Data, Archive.Size, &Entries, &EntryCount))
+    {
+        printf("%s is not a valid archive\n", ArchiveFilename);
+        return -1;
+    }
+    
+    // keep only the requested entries, in place. Requested names are 
+    // normalized the same way stored ones are
+    if (FileCount > 0)
+    {
+        bool *Found = (bool *)calloc(FileCount, sizeof(bool));
+        char **RequestedNames = (char **)calloc(FileCount, sizeof(char *));
+        for (int FileI = 0; FileI < FileCount; ++FileI)
+        {
+            RequestedNames[FileI] = NormalizeArchiveName(Filenames[FileI]);
+        }
+        
+        size_t SelectedCount = 0;
+        for (size_t EntryI = 0; EntryI < EntryCount; ++EntryI)
+        {
+            bool Selected = false;
+            for (int FileI = 0; FileI < FileCount; ++FileI)
+            {
+                memory Name = Entries[EntryI].Name;
+                if (strlen(RequestedNames[FileI]) == Name.Size && 
+                    memcmp(RequestedNames[FileI], Name.Data, Name.Size) == 0)
+                {
+                    Found[FileI] = true;
+                    Selected = true;
+                }
+            }
+            
+            if (Selected)
+            {
+                Entries[SelectedCount++] = Entries[EntryI];
+            }
+        }
+        EntryCount = SelectedCount;
+        
+        bool AllFound = true;
+        for (int FileI = 0; FileI < FileCount; ++FileI)
+        {
+            if (!Found[FileI])
+            {
+                printf("%s is not in %s\n", Filenames[FileI], ArchiveFilename);
+                AllFound = false;
+            }
+            free(RequestedNames[FileI]);
+        }
+        free(RequestedNames);
+        free(Found);
+        
+        if (!AllFound)
+        {
+            return -1;
+        }
+    }
+    
+    memory *Outputs = (memory *)calloc(EntryCount, sizeof(memory));
+    if (!ExtractArchive(Entries, EntryCount, Outputs))
+    {
+        printf("%s is corrupted\n", ArchiveFilename);
+        return -1;
+    }
+    
+    int Result = 0;
+    for (size_t EntryI = 0; EntryI < EntryCount; ++EntryI)
+    {
+        memory Name = Entries[EntryI].Name;
+        char *Filename = (char *)calloc(Name.Size + 1, 1);
+        memcpy(Filename, Name.Data, Name.Size);
+        
+        // never write outside the current directory, archives written by
+        // ArchiveFiles only hold normalized names, so anything else (absolute paths, 
+        // drive letters, ".." components) didn't come from us. ':' is also refused since 
+        // on windows it would name a stream
+        char *Normalized = NormalizeArchiveName(Filename);
+        bool Unsafe = strcmp(Normalized, Filename) != 0 || strchr(Filename, ':');
+        free(Normalized);
+        
+        if (Unsafe)
+        {
+            printf("skipping %s, unsafe path\n", Filename);
+            Result = -1;
+        }
+        else
+        {
+            CreateParentDirectories(Filename);
+            if (!WriteEntireFile(Filename, Outputs[EntryI].Data, Outputs[EntryI].Size))
+            {
+                printf("couldn't write %s\n", Filename);
+                Result = -1;
+            }
+        }
+        
+        free(Filename);
+        free(Outputs[EntryI].Data);
+    }
+    
+    free(Outputs);
+    free(Entries);
+    free(Archive.Data);
+    
+    return Result;
+}
+
 int main(int ArgCount, char **Args)
 {
-#if 1 
-    Benchmark();
-#else
-    if (ArgCount == 4)
+    if (ArgCount == 2 && StringEqual(Args[1], "-benchmark"))
+    {
+        Benchmark();
+    }
+    else if (ArgCount >= 3 && StringEqual(Args[1], "-archive"))
+    {
+        return ArchiveFiles(Args[2], Args + 3, ArgCount - 3);
+    }
+    else if (ArgCount >= 3 && StringEqual(Args[1], "-extract"))
+    {
+        return ExtractFiles(Args[2], Args + 3, ArgCount - 3);
+    }
+    else if (ArgCount == 4)
     {
         bool Encode = false;
+        bool Append = false;
+        bool StaticModel = false;
         if (StringEqual(Args[1], "-encode"))
         {
             Encode = true;
         }
+        else if (StringEqual(Args[1], "-encode-static"))
+        {
+            Encode = true;
+            StaticModel = true;
+        }
+        else if (StringEqual(Args[1], "-append"))
+        {
+            Encode = true;
+            Append = true;
+        }
         else if (StringEqual(Args[1], "-decode"))
         {
             Encode = false;
         }
         else
         {
-            printf("usage: arith_coder.exe [-encode/-decode] [input file] [output file]\n");
+            PrintUsage();
             return -1;
         }
         
@@ -132,21 +543,33 @@ int main(int ArgCount, char **Args)
         memory Output = {};
         if (Encode)
         {
-            Output = EncodeParallel(Input.Data, Input.Size);
+            Output = EncodeParallel(Input.Data, Input.Size, MB(1), StaticModel);
         }
         else
         {
             Output = DecodeParallel(Input.Data, Input.Size);
+            if (!Output.Data)
+            {
+                printf("%s is not a valid encoded stream\n", InFilename);
+                return -1;
+            }
         }
         
-        WriteEntireFile(OutFilename, Output.Data, Output.Size);
+        // frames are self-delimiting, so appending never touches existing data
+        bool Written = Append? 
+            AppendToFile(OutFilename, Output.Data, Output.Size): 
+            WriteEntireFile(OutFilename, Output.Data, Output.Size);
+        if (!Written)
+        {
+            printf("couldn't write %s\n", OutFilename);
+            return -1;
+        }
     }
     else
     {
-        printf("usage: arith_coder.exe [-encode/-decode] [input file] [output file]\n");
+        PrintUsage();
         return -1;
     }
-#endif
     
     return 0;
 }
\ No newline at end of file